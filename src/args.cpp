@@ -1,7 +1,10 @@
 #include "args.h"
 
+#include <algorithm>
+#include <cstdlib>
 #include <filesystem>
 #include <optional>
+#include <thread>
 
 #include <lyra/lyra.hpp>
 #include <lyra/help.hpp>
@@ -11,10 +14,32 @@ namespace fs = std::filesystem;
 static app::arguments s_args;
 const app::arguments & app::args = s_args;
 
+// Timings are kept in the user's own cache directory, where no other user
+// can replace the file. Empty if there is none, which disables the history.
+static fs::path default_history_path()
+{
+    auto from_env = [](const char * name) {
+        const char * value = std::getenv(name);
+        return fs::path{value != nullptr ? value : ""};
+    };
+
+#ifdef _WIN32
+    auto cache = from_env("LOCALAPPDATA");
+#else
+    auto cache = from_env("XDG_CACHE_HOME");
+    if (cache.empty() && !from_env("HOME").empty())
+        cache = from_env("HOME") / ".cache";
+#endif
+
+    if (cache.empty())
+        return {};
+    return cache / "lua-config-formatter" / "history";
+}
+
 bool app::parse_args(int argc, char ** argv)
 {
     bool show_help = false;
-    std::string exe, input_path, output_path;
+    std::string exe, input_path, output_path, history_path;
 
     // clang-format off
     auto cli = lyra::cli()
@@ -29,7 +54,16 @@ bool app::parse_args(int argc, char ** argv)
         | lyra::opt(s_args.print_output)
             ["--print-output"]("Print formatted result(s).")
         | lyra::opt(s_args.validate_output)
-            ["--validate-output"]("Round-trip validation the result.");
+            ["--validate-output"]("Round-trip validation the result.")
+        | lyra::opt(s_args.check)
+            ["--check"]("Only verify the output(s) are already formatted.")
+        | lyra::opt(s_args.jobs, "count")
+            ["-j", "--jobs"]("Files to format in parallel, 0 for all cores.")
+        | lyra::opt(s_args.parallel_threshold, "entries")
+            ["--parallel-threshold"]
+            ("Split tables this large across threads, 0 to disable.")
+        | lyra::opt(history_path, "history-path")
+            ["--history"]("Where to keep timings used to schedule files.");
     cli |= lyra::group()
         | lyra::opt(input_path, "input-path")
             ["-i", "--input"]("Path to be formatted.").required()
@@ -55,8 +89,13 @@ bool app::parse_args(int argc, char ** argv)
     if (output_path.empty())
         output_path = input_path;
 
+    if (s_args.jobs == 0)
+        s_args.jobs = std::max(std::thread::hardware_concurrency(), 1u);
+
     s_args.exe = exe;
     s_args.input_path = input_path;
     s_args.output_path = output_path;
+    s_args.history_path =
+        history_path.empty() ? default_history_path() : fs::path{history_path};
     return true;
 }
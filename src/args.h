@@ -11,6 +11,10 @@ namespace app
         bool dry_run = false;
         bool print_output = false;
         bool validate_output = false;
+        bool check = false;
+        unsigned jobs = 0;
+        size_t parallel_threshold = 100000;
+        std::filesystem::path history_path;
         std::filesystem::path input_path;
         std::filesystem::path output_path;
     };
@@ -0,0 +1,105 @@
+#include "cost_model.h"
+#include "logging.h"
+
+#include <fstream>
+
+using namespace app;
+namespace fs = std::filesystem;
+
+namespace
+{
+    std::string to_key(const fs::path & file)
+    {
+        return fs::absolute(file).lexically_normal().string();
+    }
+}
+
+cost_model::cost_model(fs::path path) : m_path(std::move(path))
+{
+    if (m_path.empty())
+        return;
+
+    std::ifstream stream{m_path};
+    if (stream.fail())
+        return;
+
+    double total_seconds = 0;
+    uintmax_t total_size = 0;
+
+    // each line is: <seconds> <size> <path>
+    timing timing;
+    std::string file;
+    while (stream >> timing.seconds >> timing.size
+           && std::getline(stream.ignore(1), file)) {
+        total_seconds += timing.seconds;
+        total_size += timing.size;
+        m_history.insert_or_assign(std::move(file), timing);
+    }
+
+    if (total_size > 0 && total_seconds > 0)
+        m_seconds_per_byte = total_seconds / total_size;
+
+    debug("Loaded {} timing(s) from: {}", m_history.size(), m_path);
+}
+
+double cost_model::estimate(const fs::path & file, uintmax_t size)
+{
+    std::lock_guard lock{m_mutex};
+
+    auto it = m_history.find(to_key(file));
+    if (it != m_history.end())
+        it->second.seen = true;
+
+    if (it != m_history.end() && it->second.size > 0) {
+        // scale the previous timing in case the file has since grown
+        return it->second.seconds * size / it->second.size;
+    }
+
+    return m_seconds_per_byte * size;
+}
+
+void cost_model::record(const fs::path & file, uintmax_t size,
+                        double seconds)
+{
+    auto key = to_key(file);
+
+    std::lock_guard lock{m_mutex};
+    m_history.insert_or_assign(std::move(key), timing{size, seconds, true});
+}
+
+bool cost_model::save() const
+{
+    if (m_path.empty())
+        return true;
+
+    std::lock_guard lock{m_mutex};
+
+    std::error_code code;
+    auto directory = m_path.parent_path();
+    if (!directory.empty() && !fs::is_directory(directory, code)
+        && !fs::create_directories(directory, code)) {
+        error("Could not create directory: {}", directory);
+        return false;
+    }
+
+    std::ofstream stream{m_path};
+    if (stream.fail()) {
+        error("Could not save timings: {}", m_path);
+        return false;
+    }
+
+    size_t pruned = 0;
+    for (const auto & [file, timing] : m_history) {
+        if (!timing.seen && !fs::exists(file, code) && !code) {
+            pruned++;
+            continue;
+        }
+
+        stream << timing.seconds << ' ' << timing.size << ' ' << file << '\n';
+    }
+
+    if (pruned > 0)
+        debug("Pruned {} timing(s) of removed files.", pruned);
+
+    return true;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace app
+{
+    // Predicts how long a file will take to format, based on its size and
+    // the timings recorded by previous runs.
+    class cost_model
+    {
+      private:
+        struct timing
+        {
+            uintmax_t size = 0;
+            double seconds = 0;
+            bool seen = false;  // by this run, so the file still exists
+        };
+
+        std::filesystem::path m_path;
+        std::unordered_map<std::string, timing> m_history;
+        double m_seconds_per_byte = 1e-8;
+        mutable std::mutex m_mutex;
+
+      public:
+        explicit cost_model(std::filesystem::path path);
+
+        [[nodiscard]] double estimate(const std::filesystem::path & file,
+                                      uintmax_t size);
+        void record(const std::filesystem::path & file, uintmax_t size,
+                    double seconds);
+
+        // Keeps the timings of files outside this run, dropping only those
+        // of files that no longer exist.
+        bool save() const;
+    };
+}
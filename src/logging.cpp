@@ -3,10 +3,15 @@
 
 #include <fmt/color.h>
 
+#include <mutex>
+
 using namespace app;
 
 namespace
 {
+    // Files are processed in parallel, so messages are printed whole.
+    std::mutex s_print_mutex;
+
     constexpr fmt::text_style to_style(log_level level)
     {
         switch (level) {
@@ -58,6 +63,8 @@ void app::print(log_level level, std::string_view message, int depth)
     if (!should_print(level))
         return;
 
+    std::lock_guard lock{s_print_mutex};
+
     auto* out = (level >= log_level::error) ? (stderr) : (stdout);
 
     auto style = to_style(level);
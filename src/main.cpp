@@ -1,15 +1,24 @@
 #include "logging.h"
 #include "args.h"
 #include "formatter.h"
+#include "cost_model.h"
+#include "mapped_file.h"
+#include "output_writer.h"
+#include "thread_pool.h"
 
 #include <fmt/format.h>
 #include <fmt/os.h>
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <limits>
+#include <map>
+#include <mutex>
 #include <optional>
 #include <stack>
 #include <string_view>
@@ -17,6 +26,7 @@
 #include <unordered_set>
 #include <tuple>
 #include <variant>
+#include <vector>
 
 using namespace app;
 namespace fs = std::filesystem;
@@ -74,6 +84,43 @@ namespace
         }
     };
 
+    struct scheduled_file
+    {
+        fs::path path;
+        size_t position = 0;  // in the order files were found
+        uintmax_t size = 0;
+        double cost = 0;
+    };
+
+    // Orders files by their predicted cost, most expensive first, so the
+    // largest files overlap with the many small ones instead of trailing.
+    // Without `by_cost` files keep the order they were found in, printing
+    // needs that, otherwise it would hold the output of nearly every file
+    // until the largest one finishes.
+    std::vector<scheduled_file> schedule(const file_searcher & files,
+                                         cost_model & costs, bool by_cost)
+    {
+        std::vector<scheduled_file> scheduled;
+        scheduled.reserve(files.size());
+
+        for (const fs::path & path : files) {
+            std::error_code code;
+            auto size = fs::file_size(path, code);
+            if (code)
+                size = 0;
+            scheduled.push_back({path, scheduled.size(), size,
+                                 costs.estimate(path, size)});
+        }
+
+        if (by_cost) {
+            std::stable_sort(scheduled.begin(), scheduled.end(),
+                             [](const auto & lhs, const auto & rhs) {
+                                 return lhs.cost > rhs.cost;
+                             });
+        }
+        return scheduled;
+    }
+
     std::optional<std::string> format(const std::filesystem::path & path)
     {
         app::formatter formatter;
@@ -83,17 +130,21 @@ namespace
         }
 
         auto formatted = formatter.render();
+        if (!formatted) {
+            error("Could not render file: {}", path);
+            return std::nullopt;
+        }
 
         if (args.validate_output) {
             app::formatter round_trip_formatter;
-            if (round_trip_formatter.parse(formatted)) {
-                std::string round_trip = round_trip_formatter.render();
+            if (round_trip_formatter.parse(*formatted)) {
+                auto round_trip = round_trip_formatter.render();
                 if (formatted != round_trip) {
                     error("Format validation failed: {}", path);
                     debug("--- FORMATTED ---");
-                    debug("{}", formatted);
+                    debug("{}", *formatted);
                     debug("--- ROUND TRIP ---");
-                    debug("{}", round_trip);
+                    debug("{}", round_trip.value_or(""));
                     debug("--- DONE ---");
                     return std::nullopt;
                 }
@@ -103,16 +154,6 @@ namespace
         return formatted;
     }
 
-    bool make_directory(const fs::path & path)
-    {
-        auto directory = fs::is_directory(path) ? path : path.parent_path();
-        if (fs::exists(directory) || fs::create_directories(directory))
-            return true;
-
-        error("Could not create directory: {}", directory);
-        return false;
-    }
-
     fs::path determine_output(const fs::path & path)
     {
         static bool is_output_directory = fs::is_directory(args.output_path);
@@ -126,34 +167,131 @@ namespace
         return args.output_path / fs::relative(path, args.input_path);
     }
 
-    bool save_to_output(const fs::path & path, std::string_view text)
+    // Compares rendered chunks against the contents of an existing file.
+    class comparing_sink final : public render_sink
     {
-        auto output_path = determine_output(path);
+      private:
+        std::string_view m_expected;
+        size_t m_offset = 0;
 
-        if (args.print_output) {
-            fmt::print("--[[BEGIN: {0}]]\n{1}\n--[[END: {0}]]\n", output_path,
-                       text);
+      public:
+        explicit comparing_sink(std::string_view expected)
+            : m_expected(expected)
+        {
         }
 
-        if (args.dry_run) {
-            debug("{} -> {}", fs::relative(path, args.input_path), output_path);
+        auto offset() const { return m_offset; }
+        bool at_end() const { return m_offset == m_expected.size(); }
+
+        bool consume(std::string_view chunk) override
+        {
+#ifdef _WIN32
+            // files are saved in text mode, so newlines on disk are "\r\n"
+            for (char character : chunk) {
+                if (character == '\n' && next() == '\r')
+                    m_offset++;
+                if (next() != character)
+                    return false;
+                m_offset++;
+            }
             return true;
+#else
+            auto expected = m_expected.substr(m_offset, chunk.size());
+            auto mismatch = std::mismatch(expected.begin(), expected.end(),
+                                          chunk.begin());
+            m_offset += mismatch.first - expected.begin();
+            return mismatch.first == expected.end()
+                && expected.size() == chunk.size();
+#endif
+        }
+
+      private:
+        int next() const
+        {
+            if (m_offset < m_expected.size())
+                return m_expected[m_offset];
+            return -1;
         }
+    };
+
+    // Returns false if the file could not be processed, `is_formatted` is
+    // set if the existing output already matches.
+    bool check_output(const fs::path & path, bool & is_formatted)
+    {
+        auto output_path = determine_output(path);
 
-        if (!make_directory(output_path)) {
-            error("Could nto create directory: {}", output_path.parent_path());
+        app::formatter formatter;
+        if (!formatter.load(path)) {
+            error("Could not load file: {}", path);
             return false;
         }
 
-        std::ofstream stream{output_path};
-        if (stream.fail()) {
-            error("Could not save file: {}", output_path);
+        mapped_file existing{output_path};
+        if (!existing.is_open()) {
+            error("Not formatted: {} (missing)", output_path);
+            is_formatted = false;
+            return true;
+        }
+
+        comparing_sink sink{existing.view()};
+        auto status = formatter.render(sink);
+        if (status == render_status::failed) {
+            error("Could not render file: {}", path);
             return false;
         }
 
-        stream << text;
+        is_formatted = status == render_status::done && sink.at_end();
+        if (!is_formatted)
+            error("Not formatted: {} (offset {})", output_path, sink.offset());
         return true;
     }
+
+    // Prints the output of each file in the order the files were found,
+    // rather than the order they finish in.
+    class ordered_printer
+    {
+      private:
+        std::mutex m_mutex;
+        std::map<size_t, std::optional<std::string>> m_finished;
+        size_t m_next = 0;
+
+      public:
+        // Must be called once for every position, with an empty `text` if
+        // there is nothing to print.
+        void print(size_t position, std::optional<std::string> text)
+        {
+            std::lock_guard lock{m_mutex};
+            m_finished.emplace(position, std::move(text));
+
+            auto it = m_finished.begin();
+            for (; it != m_finished.end() && it->first == m_next; ++it) {
+                if (it->second)
+                    fmt::print("{}", it->second.value());
+                m_next++;
+            }
+            m_finished.erase(m_finished.begin(), it);
+        }
+    };
+
+    std::string to_printed(const fs::path & path, std::string_view text)
+    {
+        return fmt::format("--[[BEGIN: {0}]]\n{1}\n--[[END: {0}]]\n",
+                           determine_output(path), text);
+    }
+
+    bool save_to_output(output_writer & writer, const fs::path & path,
+                        std::string text)
+    {
+        auto output_path = determine_output(path);
+
+        if (args.dry_run) {
+            debug("{} -> {}", fs::relative(path, args.input_path), output_path);
+            return true;
+        }
+
+        writer.write(std::move(output_path), std::move(text));
+        return !writer.failed();
+    }
 }
 
 int main(int argc, char ** argv)
@@ -163,12 +301,22 @@ int main(int argc, char ** argv)
 
     info("{} v0.0.1-alpha", args.exe.filename());
     debug("arguments:");
-    debug("- verbosity:       {}", args.verbosity);
-    debug("- dry_run:         {}", args.dry_run ? "true" : "false");
-    debug("- print_output:    {}", args.print_output ? "true" : "false");
-    debug("- validate_output: {}", args.validate_output ? "true" : "false");
-    debug("- input_path:      {}", args.input_path);
-    debug("- output_path:     {}", args.output_path);
+    debug("- verbosity:          {}", args.verbosity);
+    debug("- dry_run:            {}", args.dry_run ? "true" : "false");
+    debug("- print_output:       {}", args.print_output ? "true" : "false");
+    debug("- validate_output:    {}", args.validate_output ? "true" : "false");
+    debug("- check:              {}", args.check ? "true" : "false");
+    debug("- input_path:         {}", args.input_path);
+    debug("- output_path:        {}", args.output_path);
+    debug("- jobs:               {}", args.jobs);
+    debug("- parallel_threshold: {}", args.parallel_threshold);
+    debug("- history_path:       {}", args.history_path);
+
+    if (args.check && (args.print_output || args.validate_output)) {
+        error("--check cannot be combined with --print-output or "
+              "--validate-output.");
+        return 1;
+    }
 
     if (!std::filesystem::exists(args.input_path)) {
         error("Input path not found: {}", args.input_path);
@@ -181,17 +329,79 @@ int main(int argc, char ** argv)
         return 0;
     }
 
-    size_t index = 0;
+    cost_model costs{args.history_path};
+    auto scheduled = schedule(files, costs, !args.print_output);
+
+    // checks only read, so there is nothing to save
+    std::optional<output_writer> writer;
+    if (!args.check)
+        writer.emplace();
+
+    ordered_printer printer;
+    std::atomic<size_t> index = 0;
+    std::atomic<bool> aborted = false;
+    std::atomic<size_t> unformatted = 0;
     double percent_multipier = 100.0 / files.size();
-    for (const fs::path & path : files) {
-        verbose("[{0:>3.0f}%] {1} of {2}: {3}", ++index * percent_multipier,
-                index, files.size(), path);
-        if (auto formatted = format(path)) {
-            if (save_to_output(path, formatted.value()))
-                continue;
-        }
-        info("Problems encountered, aborted.");
-        break;
+
+    // Returns false if the file could not be processed, `printed` is set if
+    // there is output to print.
+    auto process = [&](const scheduled_file & file,
+                       std::optional<std::string> & printed) {
+        auto count = ++index;
+        verbose("[{0:>3.0f}%] {1} of {2}: {3}", count * percent_multipier,
+                count, files.size(), file.path);
+
+        if (args.check) {
+            bool is_formatted = true;
+            if (!check_output(file.path, is_formatted))
+                return false;
+
+            if (!is_formatted)
+                unformatted++;
+            return true;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        auto formatted = format(file.path);
+        if (!formatted)
+            return false;
+
+        std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+        costs.record(file.path, file.size, elapsed.count());
+        if (args.print_output)
+            printed = to_printed(file.path, formatted.value());
+        return save_to_output(writer.value(), file.path,
+                              std::move(formatted.value()));
+    };
+
+    {
+        thread_pool pool{args.jobs};
+        for (const auto & file : scheduled) {
+            pool.submit([&] {
+                std::optional<std::string> printed;
+                if (!aborted && !process(file, printed)) {
+                    if (!aborted.exchange(true))
+                        info("Problems encountered, aborted.");
+                }
+
+                printer.print(file.position, std::move(printed));
+            });
+        }
+        pool.wait();
+    }
+
+    // only runs that save their output keep the timings
+    if (!args.dry_run && !args.check)
+        costs.save();
+
+    if (writer && !writer->finish())
+        info("Problems encountered while saving.");
+
+    if (args.check) {
+        info("Done. Checked {} file(s), {} not formatted.", files.size(),
+             unformatted.load());
+        return unformatted > 0 || aborted ? 1 : 0;
     }
 
     info("Done. Formatted {} file(s).", files.size());
@@ -0,0 +1,92 @@
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#    define WIN32_LEAN_AND_MEAN
+#    define NOMINMAX
+#    include <windows.h>
+#else
+#    include <fcntl.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <unistd.h>
+#endif
+
+using namespace app;
+
+#ifdef _WIN32
+mapped_file::mapped_file(const std::filesystem::path & path)
+{
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                              nullptr, OPEN_EXISTING,
+                              FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) {
+        CloseHandle(file);
+        return;
+    }
+
+    // empty files cannot be mapped, but are still valid
+    if (size.QuadPart > 0) {
+        m_mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0,
+                                       nullptr);
+        if (m_mapping != nullptr) {
+            m_data = static_cast<const char *>(
+                MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+        }
+        if (m_data == nullptr) {
+            CloseHandle(file);
+            return;
+        }
+        m_size = static_cast<size_t>(size.QuadPart);
+    }
+
+    CloseHandle(file);
+    m_is_open = true;
+}
+
+mapped_file::~mapped_file()
+{
+    if (m_data != nullptr)
+        UnmapViewOfFile(m_data);
+    if (m_mapping != nullptr)
+        CloseHandle(m_mapping);
+}
+#else
+mapped_file::mapped_file(const std::filesystem::path & path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return;
+
+    struct stat status;
+    if (::fstat(fd, &status) != 0) {
+        ::close(fd);
+        return;
+    }
+
+    // empty files cannot be mapped, but are still valid
+    if (status.st_size > 0) {
+        auto size = static_cast<size_t>(status.st_size);
+        void * data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            ::close(fd);
+            return;
+        }
+        ::madvise(data, size, MADV_SEQUENTIAL);
+        m_data = static_cast<const char *>(data);
+        m_size = size;
+    }
+
+    ::close(fd);
+    m_is_open = true;
+}
+
+mapped_file::~mapped_file()
+{
+    if (m_data != nullptr)
+        ::munmap(const_cast<char *>(m_data), m_size);
+}
+#endif
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <filesystem>
+#include <string_view>
+
+namespace app
+{
+    // Read-only memory mapping of an entire file.
+    class mapped_file
+    {
+      private:
+        const char * m_data = nullptr;
+        size_t m_size = 0;
+        bool m_is_open = false;
+#ifdef _WIN32
+        void * m_mapping = nullptr;
+#endif
+
+      public:
+        explicit mapped_file(const std::filesystem::path & path);
+        ~mapped_file();
+
+        mapped_file(const mapped_file &) = delete;
+        mapped_file & operator=(const mapped_file &) = delete;
+
+        bool is_open() const { return m_is_open; }
+        std::string_view view() const { return {m_data, m_size}; }
+    };
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include <fmt/format.h>
+
+// Number rendering used by the formatter. The output is identical to
+// fmt's "{}" for doubles and integers, and "{:f}" for sortable keys, but
+// integer-valued doubles (the vast majority in saved variables) skip the
+// generic floating point machinery entirely.
+namespace app::numbers
+{
+    // Enough for any double rendered by `write_number`.
+    constexpr size_t max_length = 32;
+
+    namespace detail
+    {
+        constexpr char digit_pairs[] = "00010203040506070809"
+                                       "10111213141516171819"
+                                       "20212223242526272829"
+                                       "30313233343536373839"
+                                       "40414243444546474849"
+                                       "50515253545556575859"
+                                       "60616263646566676869"
+                                       "70717273747576777879"
+                                       "80818283848586878889"
+                                       "90919293949596979899";
+
+        // fmt switches to exponent notation from here on.
+        constexpr double exponent_upper = 1e16;
+        constexpr double exponent_lower = 1e-4;
+
+        inline int count_digits(uint64_t value)
+        {
+            int digits = 1;
+            while (value >= 100) {
+                value /= 100;
+                digits += 2;
+            }
+            return digits + (value >= 10);
+        }
+
+        inline char * write_unsigned(char * out, uint64_t value)
+        {
+            int digits = count_digits(value);
+            char * end = out + digits;
+            char * it = end;
+            while (value >= 100) {
+                auto pair = static_cast<size_t>(value % 100) * 2;
+                value /= 100;
+                *--it = digit_pairs[pair + 1];
+                *--it = digit_pairs[pair];
+            }
+            if (value >= 10) {
+                auto pair = static_cast<size_t>(value) * 2;
+                *--it = digit_pairs[pair + 1];
+                *--it = digit_pairs[pair];
+            }
+            else
+                *--it = static_cast<char>('0' + value);
+            return end;
+        }
+
+        // Whole numbers that print without a fraction or an exponent.
+        inline bool is_small_integer(double value)
+        {
+            return std::abs(value) < exponent_upper
+                && value == std::trunc(value)
+                && !(value == 0 && std::signbit(value));
+        }
+    }
+
+    inline char * write_integer(char * out, int64_t value)
+    {
+        auto magnitude = static_cast<uint64_t>(value);
+        if (value < 0) {
+            *out++ = '-';
+            magnitude = 0 - magnitude;
+        }
+        return detail::write_unsigned(out, magnitude);
+    }
+
+    // Shortest round-trip representation, matches fmt's "{}".
+    inline char * write_number(char * out, double value)
+    {
+        if (detail::is_small_integer(value))
+            return write_integer(out, static_cast<int64_t>(value));
+
+        if (!std::isfinite(value))
+            return fmt::format_to(out, "{}", value);
+
+        if (value == 0) {
+            // negative zero, to_chars would use an exponent here
+            std::memcpy(out, "-0", 2);
+            return out + 2;
+        }
+
+        auto magnitude = std::abs(value);
+        auto format = magnitude >= detail::exponent_lower
+                           && magnitude < detail::exponent_upper
+                        ? std::chars_format::fixed
+                        : std::chars_format::scientific;
+        return std::to_chars(out, out + max_length, value, format).ptr;
+    }
+
+    // Six decimals, right aligned to `width`, matches fmt's "{:>{}f}".
+    template <typename Buffer>
+    void append_fixed(Buffer & out, double value, int width)
+    {
+        if (!detail::is_small_integer(value)) {
+            fmt::format_to(std::back_inserter(out), "{:>{}f}", value, width);
+            return;
+        }
+
+        char buffer[max_length];
+        char * end = write_integer(buffer, static_cast<int64_t>(value));
+        std::memcpy(end, ".000000", 7);
+        end += 7;
+
+        auto length = static_cast<int>(end - buffer);
+        if (width > length)
+            out.append(static_cast<size_t>(width - length), ' ');
+        out.append(buffer, end - buffer);
+    }
+}
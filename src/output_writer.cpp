@@ -0,0 +1,565 @@
+#include "output_writer.h"
+#include "logging.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string_view>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#if defined(__linux__) && __has_include(<liburing.h>)
+#    define APP_HAS_IO_URING 1
+#    include <cerrno>
+#    include <cstring>
+#    include <fcntl.h>
+#    include <unistd.h>
+#    include <liburing.h>
+#endif
+
+using namespace app;
+namespace fs = std::filesystem;
+
+class output_writer::backend
+{
+  public:
+    struct job
+    {
+        fs::path path;
+        std::string text;
+    };
+
+  private:
+    // Output allowed to wait in memory before write() blocks the caller.
+    static constexpr size_t queued_bytes_limit = 256 * 1024 * 1024;
+
+    std::mutex m_queued_mutex;
+    std::condition_variable m_queued_freed;
+    size_t m_queued_bytes = 0;
+
+  protected:
+    std::atomic<bool> m_failed = false;
+
+  public:
+    virtual ~backend() = default;
+
+    void write(job job)
+    {
+        reserve(job.text.size());
+        submit(std::move(job));
+    }
+
+    virtual void finish() = 0;
+
+    bool failed() const { return m_failed; }
+
+  protected:
+    virtual void submit(job job) = 0;
+
+    // Blocks while too much output is queued, a single file larger than the
+    // limit is still let through once nothing else is waiting.
+    void reserve(size_t size)
+    {
+        std::unique_lock lock{m_queued_mutex};
+        m_queued_freed.wait(lock, [&] {
+            return m_queued_bytes == 0
+                || m_queued_bytes + size <= queued_bytes_limit;
+        });
+        m_queued_bytes += size;
+    }
+
+    void release(size_t size)
+    {
+        {
+            std::lock_guard lock{m_queued_mutex};
+            m_queued_bytes -= size;
+        }
+        m_queued_freed.notify_all();
+    }
+};
+
+namespace
+{
+    using job = output_writer::backend::job;
+
+    class directory_cache
+    {
+      private:
+        std::mutex m_mutex;
+        std::unordered_set<std::string> m_created;
+
+      public:
+        bool ensure(const fs::path & directory)
+        {
+            if (directory.empty())
+                return true;
+
+            std::lock_guard lock{m_mutex};
+            auto key = directory.string();
+            if (m_created.contains(key))
+                return true;
+
+            std::error_code code;
+            if (!fs::is_directory(directory, code)
+                && !fs::create_directories(directory, code)) {
+                error("Could not create directory: {}", directory);
+                return false;
+            }
+
+            m_created.emplace(std::move(key));
+            return true;
+        }
+    };
+
+    class pooled_backend final : public output_writer::backend
+    {
+      private:
+        static constexpr size_t thread_count = 4;
+
+        directory_cache m_directories;
+        thread_pool m_pool{thread_count};
+
+      public:
+        void finish() override { m_pool.wait(); }
+
+      protected:
+        void submit(job job) override
+        {
+            m_pool.submit([this, job = std::move(job)] {
+                if (!save(job))
+                    m_failed = true;
+                release(job.text.size());
+            });
+        }
+
+      private:
+        bool save(const job & job)
+        {
+            if (!m_directories.ensure(job.path.parent_path()))
+                return false;
+
+            std::ofstream stream{job.path};
+            if (stream.fail()) {
+                error("Could not save file: {}", job.path);
+                return false;
+            }
+
+            stream << job.text;
+            stream.close();
+            if (stream.fail()) {
+                error("Could not write file: {}", job.path);
+                return false;
+            }
+
+            return true;
+        }
+    };
+
+#if APP_HAS_IO_URING
+    // Opens, writes and closes every file through the ring, so the file
+    // system work of many files overlaps on a single thread. Each file is
+    // driven by its completions: open, then as many writes as it takes, then
+    // close.
+    class uring_backend final : public output_writer::backend
+    {
+      private:
+        static constexpr unsigned queue_depth = 64;
+        static constexpr int submit_attempts = 16;
+
+        enum class stage
+        {
+            open,
+            write,
+            close,
+        };
+
+        struct slot
+        {
+            fs::path path;
+            std::string text;
+            int fd = -1;
+            size_t written = 0;
+            stage current = stage::open;
+            bool success = true;
+        };
+
+        struct prepared
+        {
+            unsigned index;
+            io_uring_sqe * sqe;
+        };
+
+        // Marks no-ops left behind by a ring that refused to submit.
+        static constexpr uint64_t ignored = ~uint64_t{0};
+
+        directory_cache m_directories;
+        io_uring m_ring{};
+        bool m_has_ring = false;
+
+        std::mutex m_mutex;
+        std::condition_variable m_wake;
+        std::condition_variable m_idle;
+        std::deque<job> m_queue;
+        size_t m_pending = 0;  // queued and in flight
+        bool m_stopping = false;
+
+        // only used by the writer thread
+        std::vector<slot> m_slots{queue_depth};
+        std::vector<unsigned> m_free_slots;
+        std::vector<prepared> m_prepared;  // not yet submitted
+        size_t m_in_flight = 0;  // submitted, not yet completed
+        bool m_broken = false;  // the ring refused to submit
+        std::thread m_thread;
+
+        uring_backend() = default;
+
+      public:
+        // Returns null if io_uring is unavailable, e.g. disabled by the
+        // kernel or blocked by a seccomp profile, or if the kernel is too old
+        // to open and close files through it.
+        static std::unique_ptr<uring_backend> create()
+        {
+            std::unique_ptr<uring_backend> backend{new uring_backend};
+            if (io_uring_queue_init(queue_depth, &backend->m_ring, 0) < 0)
+                return nullptr;
+            backend->m_has_ring = true;
+
+            if (!backend->supports_files())
+                return nullptr;
+
+            for (unsigned i = queue_depth; i > 0; i--)
+                backend->m_free_slots.push_back(i - 1);
+
+            backend->m_thread = std::thread{&uring_backend::run,
+                                            backend.get()};
+            return backend;
+        }
+
+        ~uring_backend() override
+        {
+            {
+                std::lock_guard lock{m_mutex};
+                m_stopping = true;
+            }
+            m_wake.notify_one();
+            if (m_thread.joinable())
+                m_thread.join();
+
+            if (m_has_ring)
+                io_uring_queue_exit(&m_ring);
+        }
+
+        void finish() override
+        {
+            std::unique_lock lock{m_mutex};
+            m_idle.wait(lock, [this] { return m_pending == 0; });
+        }
+
+      protected:
+        void submit(job job) override
+        {
+            {
+                std::lock_guard lock{m_mutex};
+                m_queue.emplace_back(std::move(job));
+                m_pending++;
+            }
+            m_wake.notify_one();
+        }
+
+      private:
+        bool supports_files()
+        {
+            auto * probe = io_uring_get_probe_ring(&m_ring);
+            if (probe == nullptr)
+                return false;
+
+            bool supported = io_uring_opcode_supported(probe, IORING_OP_OPENAT)
+                          && io_uring_opcode_supported(probe, IORING_OP_WRITE)
+                          && io_uring_opcode_supported(probe, IORING_OP_CLOSE);
+            io_uring_free_probe(probe);
+            return supported;
+        }
+
+        void run()
+        {
+            std::vector<job> batch;
+
+            while (true) {
+                {
+                    std::unique_lock lock{m_mutex};
+                    if (m_in_flight == 0 && m_prepared.empty()) {
+                        m_wake.wait(lock, [this] {
+                            return m_stopping || !m_queue.empty();
+                        });
+                        if (m_queue.empty())
+                            return;  // only reachable once stopping
+                    }
+
+                    while (!m_queue.empty()
+                           && batch.size() < m_free_slots.size()) {
+                        batch.emplace_back(std::move(m_queue.front()));
+                        m_queue.pop_front();
+                    }
+                }
+
+                for (auto & job : batch)
+                    start(std::move(job));
+                batch.clear();
+
+                submit_prepared();
+                if (m_in_flight > 0)
+                    reap();
+            }
+        }
+
+        void start(job job)
+        {
+            if (m_broken) {
+                error("Could not save file: {}", job.path);
+                return complete(false, job.text.size());
+            }
+
+            if (!m_directories.ensure(job.path.parent_path()))
+                return complete(false, job.text.size());
+
+            auto index = m_free_slots.back();
+            m_free_slots.pop_back();
+            m_slots[index] = {std::move(job.path), std::move(job.text)};
+
+            if (auto * sqe = prepare(index)) {
+                io_uring_prep_openat(sqe, AT_FDCWD, m_slots[index].path.c_str(),
+                                     O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                                     0666);
+            }
+        }
+
+        // Returns the sqe for the next step of a file, or null if the ring
+        // is broken, in which case the file has been failed.
+        io_uring_sqe * prepare(unsigned index)
+        {
+            if (m_broken) {
+                abandon(index);
+                return nullptr;
+            }
+
+            // at most one operation per slot, so sqes never run out
+            auto * sqe = io_uring_get_sqe(&m_ring);
+            sqe->user_data = index;
+            m_prepared.push_back({index, sqe});
+            return sqe;
+        }
+
+        void queue_write(unsigned index)
+        {
+            auto & slot = m_slots[index];
+            slot.current = stage::write;
+            if (slot.written == slot.text.size())
+                return queue_close(index);
+
+            std::string_view remaining{slot.text};
+            remaining.remove_prefix(slot.written);
+            if (auto * sqe = prepare(index)) {
+                io_uring_prep_write(sqe, slot.fd, remaining.data(),
+                                    static_cast<unsigned>(std::min<size_t>(
+                                        remaining.size(), 1u << 30)),
+                                    slot.written);
+            }
+        }
+
+        void queue_close(unsigned index)
+        {
+            auto & slot = m_slots[index];
+            slot.current = stage::close;
+            if (auto * sqe = prepare(index))
+                io_uring_prep_close(sqe, slot.fd);
+        }
+
+        // Submits everything prepared. Busy rings are retried once some
+        // completions have been reaped, anything the ring still refuses is
+        // turned into no-ops and its files fail.
+        void submit_prepared()
+        {
+            int attempts = 0;
+            while (!m_prepared.empty()) {
+                int result = io_uring_submit(&m_ring);
+                if (result > 0) {
+                    m_in_flight += result;
+                    m_prepared.erase(m_prepared.begin(),
+                                     m_prepared.begin() + result);
+                    continue;
+                }
+
+                bool busy = result == 0 || result == -EINTR
+                         || result == -EAGAIN || result == -EBUSY;
+                if (busy && attempts++ < submit_attempts) {
+                    if (m_in_flight > 0)
+                        reap();
+                    else
+                        std::this_thread::yield();
+                    continue;
+                }
+
+                error("Could not submit to io_uring: {}",
+                      std::strerror(-result));
+                m_broken = true;
+
+                auto refused = std::move(m_prepared);
+                m_prepared.clear();
+                for (auto [index, sqe] : refused) {
+                    io_uring_prep_nop(sqe);
+                    sqe->user_data = ignored;
+                    abandon(index);
+                }
+            }
+        }
+
+        // Waits for at least one completion, then handles every completion
+        // that is ready.
+        void reap()
+        {
+            io_uring_cqe * cqe = nullptr;
+            int result = io_uring_wait_cqe(&m_ring, &cqe);
+            while (result == -EINTR)
+                result = io_uring_wait_cqe(&m_ring, &cqe);
+            if (result < 0) {
+                error("Could not wait for io_uring: {}",
+                      std::strerror(-result));
+                return fail_in_flight();
+            }
+
+            do {
+                auto user_data = cqe->user_data;
+                auto result = cqe->res;
+                io_uring_cqe_seen(&m_ring, cqe);
+
+                if (user_data == ignored)
+                    continue;
+
+                m_in_flight--;
+                advance(static_cast<unsigned>(user_data), result);
+            } while (io_uring_peek_cqe(&m_ring, &cqe) == 0);
+        }
+
+        void advance(unsigned index, int result)
+        {
+            auto & slot = m_slots[index];
+            switch (slot.current) {
+                case stage::open:
+                    if (result < 0) {
+                        error("Could not save file: {}", slot.path);
+                        slot.success = false;
+                        return finish(index);
+                    }
+                    slot.fd = result;
+                    return queue_write(index);
+
+                case stage::write:
+                    if (result <= 0) {
+                        error("Could not write file: {}", slot.path);
+                        slot.success = false;
+                        return queue_close(index);
+                    }
+                    slot.written += static_cast<size_t>(result);
+                    return queue_write(index);
+
+                case stage::close:
+                    if (result < 0 && slot.success) {
+                        error("Could not write file: {}", slot.path);
+                        slot.success = false;
+                    }
+                    slot.fd = -1;
+                    return finish(index);
+            }
+        }
+
+        // Fails a file whose next step could not be queued.
+        void abandon(unsigned index)
+        {
+            auto & slot = m_slots[index];
+            error("Could not write file: {}", slot.path);
+            if (slot.fd >= 0)
+                ::close(slot.fd);
+            slot.fd = -1;
+            slot.success = false;
+            finish(index);
+        }
+
+        // Without completions nothing in flight can make progress, fails
+        // those files and stops using the ring.
+        void fail_in_flight()
+        {
+            m_broken = true;
+            m_in_flight = 0;
+            for (unsigned index = 0; index < queue_depth; index++) {
+                if (std::find(m_free_slots.begin(), m_free_slots.end(), index)
+                    == m_free_slots.end())
+                    abandon(index);
+            }
+        }
+
+        void finish(unsigned index)
+        {
+            auto & slot = m_slots[index];
+            bool success = slot.success;
+            auto size = slot.text.size();
+            slot = {};
+            m_free_slots.push_back(index);
+            complete(success, size);
+        }
+
+        void complete(bool success, size_t size)
+        {
+            if (!success)
+                m_failed = true;
+            release(size);
+
+            std::lock_guard lock{m_mutex};
+            if (--m_pending == 0)
+                m_idle.notify_all();
+        }
+    };
+#endif
+
+    std::unique_ptr<output_writer::backend> make_backend()
+    {
+#if APP_HAS_IO_URING
+        if (auto backend = uring_backend::create()) {
+            debug("Saving files with io_uring.");
+            return backend;
+        }
+        debug("io_uring unavailable, falling back to a thread pool.");
+#endif
+        return std::make_unique<pooled_backend>();
+    }
+}
+
+output_writer::output_writer() : m_backend(make_backend())
+{
+}
+
+output_writer::~output_writer()
+{
+    m_backend->finish();
+}
+
+void output_writer::write(fs::path path, std::string text)
+{
+    m_backend->write({std::move(path), std::move(text)});
+}
+
+bool output_writer::failed() const
+{
+    return m_backend->failed();
+}
+
+bool output_writer::finish()
+{
+    m_backend->finish();
+    return !m_backend->failed();
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <filesystem>
+#include <memory>
+#include <string>
+
+namespace app
+{
+    // Saves formatted files in the background so formatting never waits on
+    // the disk. Uses io_uring where available, otherwise a small thread pool.
+    class output_writer
+    {
+      public:
+        class backend;
+
+      private:
+        std::unique_ptr<backend> m_backend;
+
+      public:
+        output_writer();
+        ~output_writer();
+
+        void write(std::filesystem::path path, std::string text);
+
+        // Returns true if any write has failed so far.
+        [[nodiscard]] bool failed() const;
+
+        // Blocks until every queued write has completed.
+        [[nodiscard]] bool finish();
+    };
+}
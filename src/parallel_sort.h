@@ -0,0 +1,46 @@
+#pragma once
+
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <iterator>
+#include <vector>
+
+namespace app
+{
+    // Sorts [first, last) by sorting one run per pool thread, then merging
+    // neighbouring runs pairwise until a single run is left. Like std::sort
+    // this is not stable, so `compare` should be a total order when the
+    // result has to match a serial sort.
+    template <typename Iterator, typename Compare>
+    void parallel_sort(thread_pool & pool, Iterator first, Iterator last,
+                       Compare compare)
+    {
+        auto size = static_cast<size_t>(std::distance(first, last));
+        auto runs = std::min(pool.size(), size);
+        if (runs <= 1)
+            return std::sort(first, last, compare);
+
+        std::vector<Iterator> bounds;
+        bounds.reserve(runs + 1);
+        for (size_t i = 0; i <= runs; i++)
+            bounds.push_back(first + size * i / runs);
+
+        parallel_for(pool, runs, [&](size_t i) {
+            std::sort(bounds[i], bounds[i + 1], compare);
+        });
+
+        for (size_t width = 1; width < runs; width *= 2) {
+            auto merges = (runs + 2 * width - 1) / (2 * width);
+            parallel_for(pool, merges, [&](size_t i) {
+                auto low = i * 2 * width;
+                auto middle = std::min(low + width, runs);
+                auto high = std::min(low + 2 * width, runs);
+                if (middle < high) {
+                    std::inplace_merge(bounds[low], bounds[middle],
+                                       bounds[high], compare);
+                }
+            });
+        }
+    }
+}
@@ -0,0 +1,694 @@
+#include "table_writer.h"
+#include "args.h"
+#include "logging.h"
+#include "numbers.h"
+#include "parallel_sort.h"
+#include "thread_pool.h"
+
+#include <sol/sol.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+using namespace app;
+
+namespace
+{
+    constexpr size_t sink_chunk_size = 64 * 1024;
+
+    const std::unordered_set<std::string_view> s_keywords = {
+        "and", "break",    "do",     "else", "elseif", "end",   "false",
+        "for", "function", "if",     "in",   "local",  "nil",   "not",
+        "or",  "repeat",   "return", "then", "true",   "until", "while",
+    };
+
+    bool is_keyword(std::string_view text)
+    {
+        return s_keywords.find(text) != s_keywords.end();
+    }
+
+    bool is_identifier(std::string_view text)
+    {
+        if (text.empty())
+            return false;
+
+        // leading character must be a letter or underscore
+        if (!std::isalpha(text[0]) && text[0] != '_')
+            return false;
+
+        if (is_keyword(text))
+            return false;
+
+        text.remove_prefix(1);
+        for (char character : text) {
+            if (!std::isalnum(character) && character != '_')
+                return false;
+        }
+
+        return true;
+    }
+
+    std::string_view to_string_view(lua_State * L, int index)
+    {
+        size_t length = 0;
+        const char * text = lua_tolstring(L, index, &length);
+        return {text, length};
+    }
+
+    void render_key(std::string & out, double number, bool sortable)
+    {
+        numbers::append_fixed(out, number, sortable ? 20 : 0);
+    }
+
+    // Whole, non-negative keys below 1e13 all pad to the same sortable
+    // width, so ordering them as numbers matches ordering their text.
+    bool is_plain_index(double number)
+    {
+        return !std::signbit(number) && number < 1e13
+            && number == std::trunc(number);
+    }
+
+    // Shared by every file, so large tables use no more threads than -j
+    // allows. Jobs are only 0 when the arguments were never parsed.
+    thread_pool & table_pool()
+    {
+        static thread_pool pool{
+            args.jobs > 0 ? args.jobs
+                          : std::max(std::thread::hardware_concurrency(), 1u)};
+        return pool;
+    }
+
+    // Mirrors what write_key does to the index of the enclosing table.
+    std::optional<double> next_index(std::optional<double> previous,
+                                     const table_key & key)
+    {
+        if (key.is_number && previous == key.number - 1)
+            return key.number;
+        return std::nullopt;
+    }
+}
+
+namespace app
+{
+    class sorted_table_keys
+    {
+      public:
+        struct entry
+        {
+            table_key key;
+            int value = 0;  // index into the value table
+            size_t offset = 0;  // numeric keys, rendered into m_numbers
+            size_t length = 0;
+        };
+
+      private:
+        lua_State * m_lua = nullptr;
+        int m_index = 0;
+        bool m_is_root = false;
+        bool m_is_indexed = false;
+        bool m_is_plain = false;
+        size_t m_count = 0;
+        std::vector<entry> m_entries;
+        std::string m_numbers;
+
+      public:
+        // Counts the keys of the table at `index`, keeping the memory used
+        // for any previous table.
+        void reset(lua_State * L, int index, bool is_root)
+        {
+            m_lua = L;
+            m_index = lua_absindex(L, index);
+            m_is_root = is_root;
+            m_is_indexed = !is_root;
+            m_is_plain = !is_root;
+            m_count = 0;
+            m_entries.clear();
+            m_numbers.clear();
+
+            lua_pushnil(L);
+            while (lua_next(L, m_index)) {
+                m_is_indexed &= lua_type(L, -2) == LUA_TNUMBER;
+                m_is_plain &= m_is_indexed
+                           && is_plain_index(lua_tonumber(L, -2));
+                m_count++;
+                lua_pop(L, 1);
+            }
+        }
+
+        auto count() const { return m_count; }
+        auto size() const { return m_entries.size(); }
+
+        auto begin() const { return m_entries.begin(); }
+        auto end() const { return m_entries.end(); }
+
+        const entry & operator[](size_t index) const
+        {
+            return m_entries[index];
+        }
+
+        // Collects and sorts the keys. `visit` is called for every entry
+        // with its value on top of the stack, and must leave it there.
+        // Returns false if a key cannot be rendered.
+        template <typename Visit>
+        [[nodiscard]] bool collect(Visit && visit, bool parallel)
+        {
+            lua_State * L = m_lua;
+            m_entries.reserve(m_count);
+
+            lua_pushnil(L);
+            while (lua_next(L, m_index)) {
+                entry entry;
+                switch (lua_type(L, -2)) {
+                    case LUA_TNUMBER:
+                        entry.key.number = lua_tonumber(L, -2);
+                        entry.key.is_number = true;
+                        if (m_is_plain)
+                            break;
+                        entry.offset = m_numbers.size();
+                        render_key(m_numbers, entry.key.number, m_is_indexed);
+                        entry.length = m_numbers.size() - entry.offset;
+                        break;
+
+                    case LUA_TSTRING:
+                        entry.key.text = to_string_view(L, -2);
+                        break;
+
+                    default:
+                        error("Encountered unsupported key type: {}",
+                              lua_typename(L, lua_type(L, -2)));
+                        lua_pop(L, 2);
+                        return false;
+                }
+
+                if (!m_is_root || !entry.key.text.starts_with("sol.")) {
+                    visit(entry);
+                    m_entries.emplace_back(entry);
+                }
+                lua_pop(L, 1);
+            }
+
+            sort(parallel);
+            return true;
+        }
+
+      private:
+        void sort(bool parallel)
+        {
+            auto sort_key = [this](const entry & entry) {
+                if (entry.key.is_number)
+                    return std::string_view{m_numbers}.substr(entry.offset,
+                                                              entry.length);
+                return entry.key.text;
+            };
+
+            // keys can only tie when a number renders the same text as
+            // another key, breaking those by number makes the order
+            // independent of which sort is used
+            auto by_text = [&](const entry & lhs, const entry & rhs) {
+                auto lhs_text = sort_key(lhs);
+                auto rhs_text = sort_key(rhs);
+                if (lhs_text != rhs_text)
+                    return lhs_text < rhs_text;
+                if (lhs.key.is_number != rhs.key.is_number)
+                    return lhs.key.is_number;
+                return lhs.key.number < rhs.key.number;
+            };
+
+            auto by_number = [](const entry & lhs, const entry & rhs) {
+                return lhs.key.number < rhs.key.number;
+            };
+
+            auto sort = [&](auto compare) {
+                if (parallel) {
+                    parallel_sort(table_pool(), m_entries.begin(),
+                                  m_entries.end(), compare);
+                }
+                else
+                    std::sort(m_entries.begin(), m_entries.end(), compare);
+            };
+
+            if (m_is_plain)
+                sort(by_number);
+            else
+                sort(by_text);
+        }
+    };
+
+    // A copy of a table's values and everything nested below them. Strings
+    // are still viewed inside Lua, which keeps them alive as long as the
+    // tables are. The entries of each table are contiguous and sorted.
+    struct table_snapshot
+    {
+        struct node
+        {
+            table_key key;
+            int type = LUA_TNIL;
+            bool boolean = false;
+            double number = 0;
+            std::string_view text;
+            size_t first = 0;  // entries of a table value
+            size_t count = 0;
+        };
+
+        std::vector<node> nodes;
+    };
+}
+
+table_writer::table_writer(lua_State * lua, size_t parallel_threshold,
+                           render_sink * sink)
+    : m_lua(lua), m_parallel_threshold(parallel_threshold), m_sink(sink)
+{
+}
+
+table_writer::table_writer(table_writer &&) = default;
+table_writer::~table_writer() = default;
+
+void table_writer::write_globals()
+{
+    lua_createtable(m_lua, 0, 0);
+    m_value_tables = lua_gettop(m_lua);
+
+    lua_pushglobaltable(m_lua);
+    write_table(-1, 0);
+    lua_pop(m_lua, 2);
+}
+
+bool table_writer::finish()
+{
+    flush(0);
+    return !m_stopped;
+}
+
+void table_writer::flush(size_t threshold)
+{
+    if (m_sink == nullptr || m_stopped || m_buffer.size() < threshold)
+        return;
+
+    if (!m_sink->consume({m_buffer.data(), m_buffer.size()}))
+        m_stopped = true;
+    m_buffer.clear();
+}
+
+void table_writer::write(double value)
+{
+    char buffer[numbers::max_length];
+    m_buffer.append(buffer, numbers::write_number(buffer, value));
+}
+
+void table_writer::write(int64_t value)
+{
+    char buffer[numbers::max_length];
+    m_buffer.append(buffer, numbers::write_integer(buffer, value));
+}
+
+void table_writer::write_indent(int depth)
+{
+    for (int i = 0; i < depth; i++)
+        write("  ");
+}
+
+void table_writer::write_escaped(std::string_view text)
+{
+    write("\"");
+    for (char character : text) {
+        switch (character) {
+            case '\r': break;
+            case '"': write("\\\""); break;
+            case '\\': write("\\\\"); break;
+            case '\t': write("\\t"); break;
+            case '\n': write("\\n"); break;
+            default: write(character); break;
+        }
+    }
+    write("\"");
+}
+
+bool table_writer::write_key(const table_key & key)
+{
+    if (key.is_number)
+        return write_key(key.number);
+    return write_key(key.text);
+}
+
+bool table_writer::write_key(std::string_view text)
+{
+    if (is_identifier(text))
+        write(text);
+    else {
+        write("[");
+        write_escaped(text);
+        write("]");
+    }
+
+    invalidate_index();
+    return true;
+}
+
+bool table_writer::write_key(double index)
+{
+    if (update_index(index)) {
+        return false;
+    }
+
+    write("[");
+    write(index);
+    write("]");
+    return true;
+}
+
+void table_writer::fail()
+{
+    m_failed = true;
+    m_stopped = true;
+}
+
+void table_writer::write_table(int index, int depth)
+{
+    if (m_stopped)
+        return;
+
+    lua_State * L = m_lua;
+    index = lua_absindex(L, index);
+
+    // key, value, value table and the copied value
+    if (!lua_checkstack(L, 4)) {
+        error("Exceeded the lua stack, tables are nested too deeply.");
+        return fail();
+    }
+
+    lua_pushnil(L);
+    if (!lua_next(L, index))
+        return write("{}");
+    lua_pop(L, 2);
+
+    auto starting_size = m_previous_index.size();
+    if (depth == 0)
+        m_previous_index.push(std::nullopt);  // disabling indexes at the root
+    else
+        m_previous_index.push(0);
+
+    if (depth > 0)
+        write("{\n");
+
+    auto & keys = keys_at(depth);
+    keys.reset(L, index, depth == 0);
+    int values = collect_values(keys, depth);
+    // a sink may stop at any byte, chunks would render far past that point
+    if (m_sink == nullptr && is_large(keys.size()) && !m_stopped)
+        write_chunked_entries(keys, values, depth);
+    else
+        write_entries(keys, values, depth);
+    lua_pop(L, 1);
+
+    if (depth > 0) {
+        write_indent(depth - 1);
+        write("}");
+    }
+
+    m_previous_index.pop();
+    assert(m_previous_index.size() == starting_size);
+}
+
+void table_writer::write_entries(const sorted_table_keys & keys, int values,
+                                 int depth)
+{
+    lua_State * L = m_lua;
+    for (const auto & entry : keys) {
+        if (m_stopped)
+            break;
+
+        lua_rawgeti(L, values, entry.value);
+        write_table_entry(entry.key, depth);
+        lua_pop(L, 1);
+    }
+}
+
+void table_writer::write_chunked_entries(const sorted_table_keys & keys,
+                                         int values, int depth)
+{
+    table_snapshot snapshot;
+    snapshot.nodes.resize(keys.size());
+    take_snapshot(keys, values, snapshot, 0, depth);
+    if (m_failed)
+        return;
+
+    auto & pool = table_pool();
+    auto chunk_count = std::min(pool.size() * 4, keys.size());
+    auto chunk_size = (keys.size() + chunk_count - 1) / chunk_count;
+    chunk_count = (keys.size() + chunk_size - 1) / chunk_size;
+
+    // replay the index up to each chunk, so they start where a serial
+    // render would have been
+    std::vector<std::optional<double>> starting_index(chunk_count);
+    auto previous = m_previous_index.top();
+    for (size_t i = 0; i < keys.size(); i++) {
+        if (i % chunk_size == 0)
+            starting_index[i / chunk_size] = previous;
+        previous = next_index(previous, keys[i].key);
+    }
+
+    // render one chunk per thread at a time, so a sink that stops early
+    // also stops the remaining chunks from being rendered
+    std::vector<table_writer> chunks;
+    for (size_t wave = 0; wave < chunk_count && !m_stopped;
+         wave += pool.size()) {
+        auto wave_size = std::min(pool.size(), chunk_count - wave);
+
+        chunks.clear();
+        for (size_t i = 0; i < wave_size; i++) {
+            auto & chunk = chunks.emplace_back(nullptr, 0);
+            chunk.m_previous_index.push(starting_index[wave + i]);
+        }
+
+        parallel_for(pool, wave_size, [&](size_t i) {
+            auto first = (wave + i) * chunk_size;
+            auto last = std::min(first + chunk_size, keys.size());
+            chunks[i].write_snapshot_entries(snapshot, first, last, depth);
+        });
+
+        for (const auto & chunk : chunks) {
+            if (m_stopped)
+                break;
+
+            m_buffer.append(chunk.view());
+            flush(sink_chunk_size);
+        }
+    }
+
+    m_previous_index.top() = previous;
+}
+
+void table_writer::write_table_entry(const table_key & key, int depth)
+{
+    write_entry_start(key, depth);
+    write_value(depth);
+    write_entry_end(key, depth);
+}
+
+void table_writer::write_value(int depth)
+{
+    lua_State * L = m_lua;
+    switch (lua_type(L, -1)) {
+        case LUA_TNIL: write("nil"); break;
+        case LUA_TNONE: write("none"); break;
+        case LUA_TBOOLEAN: write(lua_toboolean(L, -1) != 0); break;
+        case LUA_TSTRING: write_escaped(to_string_view(L, -1)); break;
+        case LUA_TNUMBER: write(lua_tonumber(L, -1)); break;
+        case LUA_TTABLE: write_table(-1, depth + 1); break;
+        default:
+            error("Encountered unsupported value type: {}",
+                  lua_typename(L, lua_type(L, -1)));
+            fail();
+            break;
+    }
+}
+
+sorted_table_keys & table_writer::keys_at(int depth)
+{
+    while (m_keys.size() <= static_cast<size_t>(depth))
+        m_keys.emplace_back(std::make_unique<sorted_table_keys>());
+    return *m_keys[depth];
+}
+
+// Collects and sorts `keys`, pushing the value table for `depth` with their
+// values stored in it. Entries left over from a previous table are unused.
+int table_writer::collect_values(sorted_table_keys & keys, int depth)
+{
+    lua_State * L = m_lua;
+    lua_rawgeti(L, m_value_tables, depth + 1);
+    if (lua_type(L, -1) != LUA_TTABLE) {
+        lua_pop(L, 1);
+        lua_createtable(L, static_cast<int>(keys.count()), 0);
+        lua_pushvalue(L, -1);
+        lua_rawseti(L, m_value_tables, depth + 1);
+    }
+
+    int values = lua_gettop(L);
+    int value_count = 0;
+    bool collected = keys.collect(
+        [&](auto & entry) {
+            entry.value = ++value_count;
+            lua_pushvalue(L, -1);
+            lua_rawseti(L, values, value_count);
+        },
+        is_large(keys.count()));
+    if (!collected)
+        fail();
+    return values;
+}
+
+// Copies the values of `keys` into the nodes starting at `first`, the
+// entries of nested tables are appended after every existing node.
+void table_writer::take_snapshot(const sorted_table_keys & keys, int values,
+                                 table_snapshot & snapshot, size_t first,
+                                 int depth)
+{
+    lua_State * L = m_lua;
+    for (size_t i = 0; i < keys.size() && !m_failed; i++) {
+        lua_rawgeti(L, values, keys[i].value);
+
+        // nested tables grow the nodes, so the node is filled in first
+        table_snapshot::node node;
+        node.key = keys[i].key;
+        node.type = lua_type(L, -1);
+        switch (node.type) {
+            case LUA_TNIL:
+            case LUA_TNONE:
+            case LUA_TTABLE: break;
+            case LUA_TBOOLEAN: node.boolean = lua_toboolean(L, -1) != 0; break;
+            case LUA_TSTRING: node.text = to_string_view(L, -1); break;
+            case LUA_TNUMBER: node.number = lua_tonumber(L, -1); break;
+            default:
+                error("Encountered unsupported value type: {}",
+                      lua_typename(L, node.type));
+                fail();
+                break;
+        }
+        snapshot.nodes[first + i] = node;
+
+        if (node.type == LUA_TTABLE)
+            snapshot_table(-1, snapshot, first + i, depth + 1);
+        lua_pop(L, 1);
+    }
+}
+
+void table_writer::snapshot_table(int index, table_snapshot & snapshot,
+                                  size_t node, int depth)
+{
+    lua_State * L = m_lua;
+    index = lua_absindex(L, index);
+
+    // key, value, value table and the copied value
+    if (!lua_checkstack(L, 4)) {
+        error("Exceeded the lua stack, tables are nested too deeply.");
+        return fail();
+    }
+
+    auto & keys = keys_at(depth);
+    keys.reset(L, index, false);
+    int values = collect_values(keys, depth);
+
+    auto first = snapshot.nodes.size();
+    snapshot.nodes[node].first = first;
+    snapshot.nodes[node].count = keys.size();
+    snapshot.nodes.resize(first + keys.size());
+    take_snapshot(keys, values, snapshot, first, depth);
+    lua_pop(L, 1);
+}
+
+void table_writer::write_snapshot_entries(const table_snapshot & snapshot,
+                                          size_t first, size_t last,
+                                          int depth)
+{
+    for (size_t i = first; i < last; i++) {
+        const auto & node = snapshot.nodes[i];
+        write_entry_start(node.key, depth);
+        switch (node.type) {
+            case LUA_TNIL: write("nil"); break;
+            case LUA_TNONE: write("none"); break;
+            case LUA_TBOOLEAN: write(node.boolean); break;
+            case LUA_TSTRING: write_escaped(node.text); break;
+            case LUA_TNUMBER: write(node.number); break;
+            case LUA_TTABLE:
+                write_snapshot_table(snapshot, i, depth + 1);
+                break;
+        }
+        write_entry_end(node.key, depth);
+    }
+}
+
+void table_writer::write_snapshot_table(const table_snapshot & snapshot,
+                                        size_t node, int depth)
+{
+    const auto & table = snapshot.nodes[node];
+    if (table.count == 0)
+        return write("{}");
+
+    m_previous_index.push(0);
+    write("{\n");
+    write_snapshot_entries(snapshot, table.first, table.first + table.count,
+                           depth);
+    write_indent(depth - 1);
+    write("}");
+    m_previous_index.pop();
+}
+
+void table_writer::write_entry_start(const table_key & key, int depth)
+{
+    write_indent(depth);
+
+    if (write_key(key)) {
+        write(" = ");
+    }
+}
+
+void table_writer::write_entry_end(const table_key & key, int depth)
+{
+    if (depth > 0)
+        write(",");
+
+    if (is_indexed()) {
+        write(" -- [");
+        write(static_cast<int64_t>(key.number));
+        write("]");
+    }
+
+    write("\n");
+    flush(sink_chunk_size);
+}
+
+bool table_writer::is_large(size_t entry_count) const
+{
+    return m_parallel_threshold > 0 && entry_count >= m_parallel_threshold;
+}
+
+bool table_writer::is_indexed() const
+{
+    return m_previous_index.top().has_value();
+}
+
+void table_writer::invalidate_index()
+{
+    if (m_previous_index.top().has_value()) {
+        m_previous_index.pop();
+        m_previous_index.push(std::nullopt);
+    }
+}
+
+bool table_writer::update_index(double index)
+{
+    if (m_previous_index.top() == index - 1) {
+        m_previous_index.pop();
+        m_previous_index.push(index);
+        return true;
+    }
+
+    invalidate_index();
+    return false;
+}
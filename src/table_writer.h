@@ -0,0 +1,127 @@
+#pragma once
+
+#include <memory>
+#include <optional>
+#include <stack>
+#include <string_view>
+#include <vector>
+
+#include <sol/sol.hpp>
+
+#include <fmt/format.h>
+
+namespace app
+{
+    // A string or numeric table key, viewed without copying it out of Lua.
+    struct table_key
+    {
+        std::string_view text;
+        double number = 0;
+        bool is_number = false;
+    };
+
+    // Receives rendered output in chunks, returning false stops rendering.
+    class render_sink
+    {
+      public:
+        virtual ~render_sink() = default;
+        virtual bool consume(std::string_view chunk) = 0;
+    };
+
+    class sorted_table_keys;
+    struct table_snapshot;
+
+    // Renders Lua tables straight from the Lua stack. Tables above the
+    // parallel threshold are copied into a snapshot, which is then rendered
+    // in chunks on worker threads, Lua is only used from the calling thread.
+    // Output passed to a sink is always rendered serially, so it can stop
+    // as soon as the sink does.
+    class table_writer
+    {
+      private:
+        lua_State * m_lua;
+        size_t m_parallel_threshold;
+        fmt::memory_buffer m_buffer;
+        std::stack<std::optional<double>> m_previous_index;
+        render_sink * m_sink = nullptr;
+        bool m_stopped = false;
+        bool m_failed = false;
+
+        // Sibling tables share the keys and the value table of their depth,
+        // the value tables are stored in the table at `m_value_tables`.
+        std::vector<std::unique_ptr<sorted_table_keys>> m_keys;
+        int m_value_tables = 0;
+
+      public:
+        // A `parallel_threshold` of 0 renders every table serially.
+        table_writer(lua_State * lua, size_t parallel_threshold,
+                     render_sink * sink = nullptr);
+        table_writer(table_writer &&);
+        ~table_writer();
+
+        void write_globals();
+
+        // Passes anything still buffered to the sink, returns false if
+        // rendering was stopped early.
+        [[nodiscard]] bool finish();
+
+        // Set when a table could not be rendered, the error has been logged.
+        bool failed() const { return m_failed; }
+
+        std::string_view view() const
+        {
+            return {m_buffer.data(), m_buffer.size()};
+        }
+
+      private:
+        template <typename T>
+        void write(T && value)
+        {
+            fmt::format_to(m_buffer, "{}", value);
+        }
+
+        void write(double value);
+        void write(int64_t value);
+        void write(std::string_view value) { m_buffer.append(value); }
+        void write(bool value) { write(value ? "true" : "false"); }
+        void write_indent(int depth);
+        void flush(size_t threshold);
+        void fail();
+        void write_escaped(std::string_view text);
+
+        bool write_key(const table_key & key);
+        bool write_key(double index);
+        bool write_key(std::string_view text);
+
+        // All operate on the Lua stack, the table is expected at `index`,
+        // values on top of the stack.
+        void write_table(int index, int depth);
+        void write_entries(const sorted_table_keys & keys, int values,
+                           int depth);
+        void write_chunked_entries(const sorted_table_keys & keys, int values,
+                                   int depth);
+        void write_table_entry(const table_key & key, int depth);
+        void write_value(int depth);
+        sorted_table_keys & keys_at(int depth);
+        int collect_values(sorted_table_keys & keys, int depth);
+        void take_snapshot(const sorted_table_keys & keys, int values,
+                           table_snapshot & snapshot, size_t first,
+                           int depth);
+        void snapshot_table(int index, table_snapshot & snapshot, size_t node,
+                            int depth);
+
+        // Never touch Lua, so these are safe to run on worker threads.
+        void write_snapshot_entries(const table_snapshot & snapshot,
+                                    size_t first, size_t last, int depth);
+        void write_snapshot_table(const table_snapshot & snapshot,
+                                  size_t node, int depth);
+        void write_entry_start(const table_key & key, int depth);
+        void write_entry_end(const table_key & key, int depth);
+
+        bool is_large(size_t entry_count) const;
+
+        bool is_indexed() const;
+        void invalidate_index();
+        bool update_index(double index);
+    };
+}
@@ -0,0 +1,61 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+using namespace app;
+
+thread_pool::thread_pool(size_t thread_count)
+{
+    thread_count = std::max<size_t>(thread_count, 1);
+    m_threads.reserve(thread_count);
+    for (size_t i = 0; i < thread_count; i++)
+        m_threads.emplace_back([this] { run(); });
+}
+
+thread_pool::~thread_pool()
+{
+    {
+        std::lock_guard lock{m_mutex};
+        m_stopping = true;
+    }
+    m_wake.notify_all();
+
+    for (auto & thread : m_threads)
+        thread.join();
+}
+
+void thread_pool::submit(std::function<void()> task)
+{
+    {
+        std::lock_guard lock{m_mutex};
+        m_tasks.emplace_back(std::move(task));
+    }
+    m_wake.notify_one();
+}
+
+void thread_pool::wait()
+{
+    std::unique_lock lock{m_mutex};
+    m_idle.wait(lock, [this] { return m_tasks.empty() && m_active == 0; });
+}
+
+void thread_pool::run()
+{
+    std::unique_lock lock{m_mutex};
+    while (true) {
+        m_wake.wait(lock, [this] { return m_stopping || !m_tasks.empty(); });
+        if (m_tasks.empty())
+            return;  // only reachable once stopping and drained
+
+        auto task = std::move(m_tasks.front());
+        m_tasks.pop_front();
+        m_active++;
+
+        lock.unlock();
+        task();
+        lock.lock();
+
+        if (--m_active == 0 && m_tasks.empty())
+            m_idle.notify_all();
+    }
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <latch>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace app
+{
+    class thread_pool
+    {
+      private:
+        std::vector<std::thread> m_threads;
+        std::deque<std::function<void()>> m_tasks;
+        std::mutex m_mutex;
+        std::condition_variable m_wake;
+        std::condition_variable m_idle;
+        size_t m_active = 0;
+        bool m_stopping = false;
+
+      public:
+        explicit thread_pool(size_t thread_count);
+        ~thread_pool();
+
+        thread_pool(const thread_pool &) = delete;
+        thread_pool & operator=(const thread_pool &) = delete;
+
+        auto size() const { return m_threads.size(); }
+
+        void submit(std::function<void()> task);
+        void wait();
+
+      private:
+        void run();
+    };
+
+    // Runs `body(i)` for every i in [0, count) on the pool and waits for all
+    // of them. The tasks must not themselves wait on the same pool.
+    template <typename Body>
+    void parallel_for(thread_pool & pool, size_t count, Body && body)
+    {
+        std::latch done{static_cast<std::ptrdiff_t>(count)};
+        for (size_t i = 0; i < count; i++) {
+            pool.submit([&, i] {
+                body(i);
+                done.count_down();
+            });
+        }
+        done.wait();
+    }
+}
@@ -0,0 +1,138 @@
+#include "logging.h"
+#include "numbers.h"
+
+#include <fmt/format.h>
+
+#include <bit>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace app;
+
+namespace
+{
+    // Values around every branch of the fast paths: zeros, the exponent
+    // limits, the largest whole doubles, subnormals and non-finite values.
+    std::vector<double> edge_values()
+    {
+        constexpr double infinity = std::numeric_limits<double>::infinity();
+        std::vector<double> values = {
+            0.0,
+            -0.0,
+            1.0,
+            -1.0,
+            0.5,
+            0.1,
+            1.0 / 3,
+            123456.789,
+            1e-4,
+            9.999999999999999e-5,
+            1e15,
+            1e16,
+            9999999999999998.0,
+            -1e16,
+            9007199254740992.0,
+            9223372036854775807.0,
+            -9223372036854775808.0,
+            1e300,
+            std::numeric_limits<double>::max(),
+            std::numeric_limits<double>::min(),
+            std::numeric_limits<double>::denorm_min(),
+            infinity,
+            -infinity,
+            std::numeric_limits<double>::quiet_NaN(),
+        };
+
+        for (double power = 1; power < 1e20; power *= 10) {
+            values.push_back(power - 1);
+            values.push_back(-power);
+            values.push_back(power + 0.5);
+        }
+        return values;
+    }
+
+    std::vector<double> random_values()
+    {
+        std::mt19937_64 random{42};
+        std::uniform_int_distribution<int64_t> whole{-1'000'000'000,
+                                                     1'000'000'000};
+        std::uniform_real_distribution<double> fraction{-1e6, 1e6};
+
+        std::vector<double> values;
+        for (int i = 0; i < 10'000; i++) {
+            values.push_back(static_cast<double>(whole(random)));
+            values.push_back(fraction(random));
+            values.push_back(std::bit_cast<double>(random()));
+        }
+        return values;
+    }
+
+    bool check(std::string_view name, double value, std::string_view expected,
+               std::string_view actual)
+    {
+        if (expected == actual)
+            return true;
+
+        error("{} of {:a} rendered '{}', expected '{}'", name, value, actual,
+              expected);
+        return false;
+    }
+
+    bool check_number(double value)
+    {
+        char buffer[numbers::max_length];
+        std::string_view actual{buffer,
+                                numbers::write_number(buffer, value)};
+        return check("write_number", value, fmt::format("{}", value), actual);
+    }
+
+    bool check_fixed(double value, int width)
+    {
+        std::string actual;
+        numbers::append_fixed(actual, value, width);
+        return check("append_fixed", value,
+                     fmt::format("{:>{}f}", value, width), actual);
+    }
+
+    bool check_integer(int64_t value)
+    {
+        char buffer[numbers::max_length];
+        std::string_view actual{buffer,
+                                numbers::write_integer(buffer, value)};
+        return check("write_integer", static_cast<double>(value),
+                     fmt::format("{}", value), actual);
+    }
+}
+
+// The fast paths must render every number exactly as fmt does, formatted
+// files would change otherwise.
+int main()
+{
+    size_t failures = 0;
+    auto record = [&](bool passed) {
+        if (!passed)
+            failures++;
+    };
+
+    for (const auto & values : {edge_values(), random_values()}) {
+        for (double value : values) {
+            record(check_number(value));
+            record(check_fixed(value, 0));
+            record(check_fixed(value, 20));
+        }
+    }
+
+    std::mt19937_64 random{7};
+    record(check_integer(std::numeric_limits<int64_t>::min()));
+    record(check_integer(std::numeric_limits<int64_t>::max()));
+    for (int i = 0; i < 100'000; i++)
+        record(check_integer(static_cast<int64_t>(random())));
+
+    if (failures > 0)
+        error("{} number(s) rendered differently.", failures);
+    return failures > 0 ? 1 : 0;
+}
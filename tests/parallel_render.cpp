@@ -0,0 +1,159 @@
+#include "logging.h"
+#include "table_writer.h"
+
+#include <sol/sol.hpp>
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+
+using namespace app;
+
+namespace
+{
+    // Covers each kind of key ordering, gaps in indexes, numbers that render
+    // the same as a string key, escaping, empty and deeply nested tables.
+    constexpr std::string_view script = R"lua(
+        sequence = {}
+        for i = 1, 2000 do
+            sequence[i] = i * 0.5
+        end
+
+        gaps = { [0] = "zero" }
+        for i = 1, 2000 do
+            if i % 7 ~= 0 then
+                gaps[i] = "value " .. i
+            end
+        end
+
+        mixed = { [1] = "number", ["1.000000"] = "string" }
+        for i = 1, 500 do
+            mixed["key" .. i] = { i, i % 3 == 0, { text = "a\tb\n\"c\"\\" } }
+            mixed[i * 1.5 - 3] = -i
+        end
+        mixed["end"] = true
+
+        deep = {}
+        local node = deep
+        for i = 1, 100 do
+            node.next = { depth = i, empty = {} }
+            node = node.next
+        end
+    )lua";
+
+    // Renders to well over 10MB, far more than a sink chunk.
+    constexpr std::string_view large_script = R"lua(
+        large = {}
+        for i = 1, 200000 do
+            large[i] = { name = "entry " .. i, values = { i, i * 2 } }
+        end
+    )lua";
+
+    class string_sink final : public render_sink
+    {
+      public:
+        std::string text;
+
+        bool consume(std::string_view chunk) override
+        {
+            text.append(chunk);
+            return true;
+        }
+    };
+
+    // Accepts the first chunk only, like a check that mismatches early.
+    class stopping_sink final : public render_sink
+    {
+      public:
+        size_t chunks = 0;
+        size_t bytes = 0;
+
+        bool consume(std::string_view chunk) override
+        {
+            chunks++;
+            bytes += chunk.size();
+            return false;
+        }
+    };
+
+    std::string render(sol::state & lua, size_t parallel_threshold)
+    {
+        table_writer writer{lua.lua_state(), parallel_threshold};
+        writer.write_globals();
+        return std::string{writer.view()};
+    }
+
+    std::string render_to_sink(sol::state & lua, size_t parallel_threshold)
+    {
+        string_sink sink;
+        table_writer writer{lua.lua_state(), parallel_threshold, &sink};
+        writer.write_globals();
+        if (!writer.finish())
+            error("Rendering stopped early.");
+        return sink.text;
+    }
+
+    bool compare(std::string_view expected, std::string_view actual,
+                 std::string_view name, size_t parallel_threshold)
+    {
+        if (expected == actual)
+            return true;
+
+        auto mismatch = std::mismatch(expected.begin(), expected.end(),
+                                      actual.begin(), actual.end());
+        error("{} with threshold {} differs from a serial render at offset {}",
+              name, parallel_threshold, mismatch.first - expected.begin());
+        return false;
+    }
+
+    // A sink that stops must stop the render, even in tables large enough to
+    // be rendered in parallel, and the output must never be held in full.
+    bool stops_early(size_t parallel_threshold)
+    {
+        sol::state lua;
+        if (!lua.do_string(large_script).valid()) {
+            error("Could not run test script.");
+            return false;
+        }
+
+        stopping_sink sink;
+        table_writer writer{lua.lua_state(), parallel_threshold, &sink};
+        writer.write_globals();
+        bool stopped = !writer.finish();
+
+        constexpr size_t limit = 1024 * 1024;
+        if (stopped && sink.chunks == 1 && sink.bytes < limit
+            && writer.view().size() < limit)
+            return true;
+
+        error("Stopping with threshold {} consumed {} chunks of {} bytes, "
+              "kept {} bytes",
+              parallel_threshold, sink.chunks, sink.bytes,
+              writer.view().size());
+        return false;
+    }
+}
+
+// Renders the same state serially and split across threads, the output must
+// be identical byte for byte.
+int main()
+{
+    sol::state lua;
+    if (!lua.do_string(script).valid()) {
+        error("Could not run test script.");
+        return 1;
+    }
+
+    auto expected = render(lua, 0);
+    bool passed = compare(expected, render_to_sink(lua, 0), "Sink", 0);
+    for (size_t parallel_threshold : {1, 3, 100, 1000}) {
+        passed &= compare(expected, render(lua, parallel_threshold), "Render",
+                          parallel_threshold);
+        passed &= compare(expected, render_to_sink(lua, parallel_threshold),
+                          "Sink", parallel_threshold);
+    }
+
+    passed &= stops_early(0);
+    passed &= stops_early(1000);
+    return passed ? 0 : 1;
+}
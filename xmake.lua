@@ -1,4 +1,7 @@
 add_requires("sol2 >=3.2.3", "fmt >=8.1.1", "lyra >=1.6")
+if is_plat("linux") then
+    add_requires("liburing", {optional = true})
+end
 add_rules("mode.debug", "mode.release")
 set_languages("c++20")
 
@@ -7,3 +10,22 @@ target("lua-config-formatter")
     add_files("src/*.cpp")
     add_headerfiles("src/*.h")
     add_packages("sol2", "fmt", "lyra")
+    if is_plat("linux") then
+        add_packages("liburing")
+        add_syslinks("pthread")
+    end
+
+-- every file in tests/ is its own test binary
+for _, file in ipairs(os.files("tests/*.cpp")) do
+    target("test_" .. path.basename(file))
+        set_kind("binary")
+        set_default(false)
+        add_files("src/*.cpp|main.cpp", file)
+        add_includedirs("src")
+        add_packages("sol2", "fmt", "lyra")
+        if is_plat("linux") then
+            add_packages("liburing")
+            add_syslinks("pthread")
+        end
+        add_tests("default")
+end